@@ -1,108 +1,2136 @@
 /*
 - External function call for use in GameMaker
 - More optimal way of fetching collisions between N rectangular projectiles
-- Uses a simple grid partitioning scheme to reduce calculations
+- Uses a dense uniform grid, built with a counting sort, to reduce calculations
+- Bullets are inserted into every cell they overlap, and the cell size can be picked automatically
+- Cells are stored as structure-of-arrays and tested 4 candidates at a time with AVX2 when the CPU has it
+- Can split the grid into bands of rows over a worker pool, with output identical to a single thread
+- Alternatively uses a sweep and prune over an x-sorted list kept between calls, for long-lived bullets
+- Or a dynamic AABB tree with fattened boxes, for bullets of very different sizes
+- A contact cache can report only the pairs that started or stopped colliding since the last call
+- Owners can be grouped into layers with an interaction matrix; the grid skips layers that don't interact, other broadphases filter per pair
+- Bullets carrying an angle can be tested as rotated rectangles, with a separating axis test after the AABB pass
+- Bullets carrying a velocity can be swept over the step, reporting when each pair first touches
+- A versioned call takes compact float32/int32 records and writes a bounded, counted int32 output
+- Per-call scratch data lives in a frame arena reset by every call, so steady-state frames don't call malloc
+- A native bullet world can own the bullets, moving and colliding them each step and returning only events
+- The last call's grid stays alive for batched circle, rectangle and raycast queries
+- Opt-in profiling counters describe the last call; the counting kernels are separate instantiations, so they cost nothing when off
 - Function call uses buffers to transfer data between GameMaker
 */
 
 #define func extern "C" __declspec(dllexport)
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <vector>
+
+#include "GMS2FrameArena.h"
+
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <cstdio>
 
+#if defined(_M_X64) || defined(__x86_64__)
+#define COLLIDE_HAS_AVX2 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 struct BulletData {
   double x0, y0, x1, y1, isActive, unitOwner;
   double bulletIndex;
 };
 
+// Record of the rotated collision call, starting with the same fields as BulletData
+// x0..y1 must still bound the whole rotated rectangle, as GameMaker's bbox_* values do
+struct RotatedBulletData {
+  double x0, y0, x1, y1, isActive, unitOwner;
+  double bulletIndex;
+  double angle;                 // Degrees, counterclockwise like image_angle
+  double halfWidth, halfHeight; // Of the unrotated rectangle, 0 or less uses the AABB itself
+};
+
+// Record of the swept collision call, starting with the same fields as BulletData
+// x0..y1 are the bounds at the start of the step, and the bullet moves by speed over the step
+struct MovingBulletData {
+  double x0, y0, x1, y1, isActive, unitOwner;
+  double bulletIndex;
+  double speedX, speedY;
+};
+
+// Version of the compact buffer layout below, returned by scr_entityGrid_abi_version
+const int COLLIDE_ABI_VERSION = 2;
+
+// Bit flags of CompactBulletData
+const uint32_t COMPACT_ACTIVE = 1;
+
+// Record of the compact collision call, 32 bytes instead of BulletData's 56
+struct CompactBulletData {
+  float x0, y0, x1, y1;
+  int32_t bulletIndex;
+  int32_t unitOwner;
+  uint32_t flags;    // COMPACT_* bits
+  uint32_t reserved; // Keeps records 16-byte aligned, set to 0
+};
+static_assert(sizeof(CompactBulletData) == 32, "CompactBulletData must match the GML buffer layout");
+
+// Header at the start of the compact call's output, followed by pairs of int32 bullet indices
+struct CompactCollisionHeader {
+  int32_t pairsFound; // Can exceed the pairs written when the output was too small
+  uint32_t flags;     // COMPACT_OVERFLOW when pairs were dropped
+};
+const uint32_t COMPACT_OVERFLOW = 1;
+
+// Records of the query calls; bullets of ignoreOwner are skipped, pass a value no owner has to keep all
+struct CircleQueryData {
+  double x, y, radius, ignoreOwner;
+};
+
+struct RectQueryData {
+  double x0, y0, x1, y1, ignoreOwner;
+};
+
+// Segment from (x0, y0) to (x1, y1)
+struct RayQueryData {
+  double x0, y0, x1, y1, ignoreOwner;
+};
+
+// Header at the start of the overlap queries' output, followed by numQueries + 1 int32 offsets
+// and then the int32 bullet indices; the results of query q are indices[offsets[q] .. offsets[q + 1])
+struct CompactQueryHeader {
+  int32_t resultsFound; // Can exceed the results written when the output was too small
+  uint32_t flags;       // COMPACT_OVERFLOW when results were dropped
+};
+
+// Result of one raycast, bulletIndex -1 when nothing was hit
+struct CompactRayHit {
+  int32_t bulletIndex;
+  float distance; // From the start of the segment
+};
+
 const int CELL_SIZE = 160;
+const int CELL_BUDGET_PER_BULLET = 4;   // Grid cells allowed per active bullet before coarsening
+const int ENTRY_BUDGET_PER_BULLET = 16; // Cell entries allowed per active bullet before coarsening
+
+// Cell size used by the grid; zero or less picks one each call from the bullet sizes
+double cellSizeSetting = CELL_SIZE;
+
+// Scratch memory of the current call; ArenaVectors drawing from it are recreated by beginCall
+FrameArena frameArena;
+
+const int MAX_LAYERS = 32;
+
+const int MAX_TABLE_OWNER = 1 << 24; // Owners are instance ids, so below this they index ownerLayerTable
 
-struct GridCell {
-  std::vector<BulletData*> bullets;
+// Collision layer of each owner; owners without an entry are on layer 0
+// Other owners, negative, fractional or too large, are looked up in otherOwnerLayers
+std::vector<unsigned char> ownerLayerTable;
+std::unordered_map<double, int> otherOwnerLayers;
+int numLayers = 1;
+
+// Bit b of layerBlocked[a] is set when layers a and b don't collide; everything collides by default
+uint32_t layerBlocked[MAX_LAYERS] = {};
+
+// Runs of consecutive layers, from layer a up, that a bullet on layer a collides with
+// The buckets of one cell are stored in layer order, so each run is a single candidate range
+struct LayerRun {
+  int first, last;
+};
+LayerRun layerRuns[MAX_LAYERS][MAX_LAYERS / 2 + 1];
+int layerRunCount[MAX_LAYERS];
+
+// Layer of each bullet in the current buffer, filled at the start of every call
+ArenaVector<unsigned char> bulletLayer = makeArenaVector<unsigned char>(frameArena);
+
+inline int layerOf(double owner) {
+  if (owner >= 0.0 && owner < (double)ownerLayerTable.size() && owner == std::floor(owner)) {
+    return ownerLayerTable[(size_t)owner];
+  }
+  if (otherOwnerLayers.empty()) { return 0; }
+  auto it = otherOwnerLayers.find(owner);
+  return (it != otherOwnerLayers.end()) ? it->second : 0;
+}
+
+void assignLayers(BulletData* bulletArray, int count) {
+  for (int layer = 0; layer < numLayers; ++layer) {
+    int runs = 0;
+    for (int other = layer; other < numLayers; ++other) {
+      if (layerBlocked[layer] & (1u << other)) { continue; }
+      if (runs > 0 && layerRuns[layer][runs - 1].last == other - 1) {
+        layerRuns[layer][runs - 1].last = other;
+      } else {
+        layerRuns[layer][runs++] = LayerRun{ other, other };
+      }
+    }
+    layerRunCount[layer] = runs;
+  }
+
+  bulletLayer.resize(count);
+  if (numLayers == 1) {
+    std::fill(bulletLayer.begin(), bulletLayer.end(), 0);
+    return;
+  }
+  for (int i = 0; i < count; ++i) {
+    bulletLayer[i] = (unsigned char)layerOf(bulletArray[i].unitOwner);
+  }
+}
+
+inline bool layersInteract(int slotA, int slotB) {
+  return ((layerBlocked[bulletLayer[slotA]] >> bulletLayer[slotB]) & 1) == 0;
+}
+
+// Range of cells overlapped by a bullet's AABB
+struct CellRange {
+  int x0, y0, x1, y1;
+};
+
+// Flags marking a cell as the first column / first row a bullet covers
+const unsigned char FIRST_COLUMN = 1;
+const unsigned char FIRST_ROW = 2;
+const unsigned char FIRST_BOTH = FIRST_COLUMN | FIRST_ROW;
+
+// Dense uniform grid, rebuilt every call with a counting sort over the cells
+// Bullets are inserted into every cell their AABB overlaps, and each cell's entries are grouped by layer
+// Storage persists between calls and only ever grows, so steady-state frames don't allocate
+// Scratch used only while building lives in the frame arena
+struct UniformGrid {
+  double originX = 0, originY = 0;
+  double cellSize = CELL_SIZE;
+  int width = 0, height = 0;
+  std::vector<int> cellStart;        // Prefix offsets into cellBullets, width * height + 1 entries
+  std::vector<int> cellBullets;      // Bullet array indices, grouped by cell
+  std::vector<CellRange> bulletCells; // Cells covered by each bullet, x0 > x1 when inactive
+  ArenaVector<double> sizeScratch = makeArenaVector<double>(frameArena); // Bullet extents, used to pick the automatic cell size
+  ArenaVector<int> bulletOrder = makeArenaVector<int>(frameArena);       // Active bullets by layer, in the order they are scattered
+
+  // Copy of each cell entry's bullet in structure-of-arrays form, in the same order as cellBullets
+  std::vector<double> entryX0, entryY0, entryX1, entryY1;
+  std::vector<double> entryOwner, entryIndex;
+  std::vector<unsigned char> entryFirst; // FIRST_* flags of the entry's cell within its bullet's range
+  std::vector<unsigned char> entryLayer;
 };
+UniformGrid grid;
 
-using GridRow = std::unordered_map<int, GridCell>;
-std::unordered_map<int, GridRow> grid;
+int getGridCoord(double offset) {
+  double cell = std::floor(offset / grid.cellSize);
+  // Keeps NaN and huge coordinates castable
+  if (!(cell > 0.0)) { return 0; }
+  if (cell > INT_MAX / 2) { return INT_MAX / 2; }
+  return (int)cell;
+}
 
 int getGridX(double x) {
-  return x / CELL_SIZE;
+  return std::min(getGridCoord(x - grid.originX), grid.width - 1);
 }
 
 int getGridY(double y) {
-  return y / CELL_SIZE;
+  return std::min(getGridCoord(y - grid.originY), grid.height - 1);
 }
 
-void addBulletToGrid(BulletData& bullet) {
-  int gx = getGridX(bullet.x0);
-  int gy = getGridY(bullet.y0);
-  grid[gx][gy].bullets.push_back(&bullet);
+// Median of the larger side of each bullet, so a few huge beams don't drag the cell size up
+double pickCellSize(BulletData* bulletArray, int count) {
+  grid.sizeScratch.clear();
+  grid.sizeScratch.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    if (!bulletArray[i].isActive) { continue; }
+    BulletData& bullet = bulletArray[i];
+    grid.sizeScratch.push_back(std::max(bullet.x1 - bullet.x0, bullet.y1 - bullet.y0));
+  }
+  if (grid.sizeScratch.empty()) { return CELL_SIZE; }
+
+  auto median = grid.sizeScratch.begin() + grid.sizeScratch.size() / 2;
+  std::nth_element(grid.sizeScratch.begin(), median, grid.sizeScratch.end());
+
+  // Twice the typical size means a typical bullet touches at most four cells
+  double size = *median * 2.0;
+  return (size >= 1.0) ? size : 1.0;
 }
 
-func double scr_entityGrid_bullets_collide(double* bulletBuffer, double* bulletCollisionsOut, double numBullets) {
-  BulletData* bulletArray = reinterpret_cast<BulletData*>(bulletBuffer);
+void buildGrid(BulletData* bulletArray, int count) {
+  grid.bulletCells.resize(count);
 
-  // Reset grid
-  grid.clear();
+  // Find the occupied area; bullets with infinite or NaN bounds still go in the edge cells but don't stretch it
+  double minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+  int numActive = 0;
+  for (int i = 0; i < count; ++i) {
+    if (!bulletArray[i].isActive) { continue; }
+    BulletData& bullet = bulletArray[i];
+    numActive++;
+    if (!(std::isfinite(bullet.x0) && std::isfinite(bullet.y0) && std::isfinite(bullet.x1) && std::isfinite(bullet.y1))) { continue; }
+    minX = std::min(minX, bullet.x0); maxX = std::max(maxX, bullet.x1);
+    minY = std::min(minY, bullet.y0); maxY = std::max(maxY, bullet.y1);
+  }
 
-  // Populate the grid with bullets
-  for (int i = 0; i < numBullets; ++i) {
-    if (bulletArray[i].isActive) {
-      addBulletToGrid(bulletArray[i]);
+  if (numActive == 0) {
+    grid.width = grid.height = 0;
+    std::fill(grid.bulletCells.begin(), grid.bulletCells.end(), CellRange{ 0, 0, -1, -1 });
+    return;
+  }
+
+  if (minX > maxX) { minX = minY = maxX = maxY = 0.0; }
+  // Capped so that bullets at opposite ends of the double range still give a finite width
+  double spanX = std::min(maxX - minX, DBL_MAX), spanY = std::min(maxY - minY, DBL_MAX);
+  grid.originX = minX;
+  grid.originY = minY;
+  grid.cellSize = (cellSizeSetting > 0.0) ? cellSizeSetting : pickCellSize(bulletArray, count);
+
+  // Coarsen until both the cell count and the number of cell entries stay linear in the bullet count
+  double cellBudget = (double)numActive * CELL_BUDGET_PER_BULLET + 4096.0;
+  double entryBudget = (double)numActive * ENTRY_BUDGET_PER_BULLET;
+  long long numEntries = 0;
+  while (true) {
+    double width = std::floor(spanX / grid.cellSize) + 1.0;
+    double height = std::floor(spanY / grid.cellSize) + 1.0;
+    if (!(width * height <= cellBudget)) {
+      grid.cellSize *= 2.0;
+      continue;
+    }
+    grid.width = (int)width;
+    grid.height = (int)height;
+
+    numEntries = 0;
+    for (int i = 0; i < count; ++i) {
+      if (!bulletArray[i].isActive) {
+        grid.bulletCells[i] = CellRange{ 0, 0, -1, -1 };
+        continue;
+      }
+      BulletData& bullet = bulletArray[i];
+      CellRange range{ getGridX(bullet.x0), getGridY(bullet.y0), getGridX(bullet.x1), getGridY(bullet.y1) };
+      grid.bulletCells[i] = range;
+      numEntries += (long long)(range.x1 - range.x0 + 1) * (range.y1 - range.y0 + 1);
+    }
+    if (numEntries <= entryBudget || (grid.width == 1 && grid.height == 1)) { break; }
+    grid.cellSize *= 2.0;
+  }
+
+  // Stable counting sort of the active bullets by layer, so that scattering them leaves each cell's entries in layer order
+  int layerStart[MAX_LAYERS + 1] = {};
+  for (int i = 0; i < count; ++i) {
+    if (grid.bulletCells[i].x0 <= grid.bulletCells[i].x1) { layerStart[bulletLayer[i] + 1]++; }
+  }
+  for (int layer = 0; layer < numLayers; ++layer) {
+    layerStart[layer + 1] += layerStart[layer];
+  }
+  grid.bulletOrder.resize(layerStart[numLayers]);
+  for (int i = 0; i < count; ++i) {
+    if (grid.bulletCells[i].x0 <= grid.bulletCells[i].x1) { grid.bulletOrder[layerStart[bulletLayer[i]]++] = i; }
+  }
+
+  int numCells = grid.width * grid.height;
+  grid.cellStart.assign(numCells + 1, 0);
+
+  // Count bullets per cell
+  for (int i : grid.bulletOrder) {
+    CellRange& range = grid.bulletCells[i];
+    for (int cy = range.y0; cy <= range.y1; ++cy) {
+      for (int cx = range.x0; cx <= range.x1; ++cx) {
+        grid.cellStart[cy * grid.width + cx + 1]++;
+      }
+    }
+  }
+
+  // Prefix sum into start offsets
+  for (int c = 0; c < numCells; ++c) {
+    grid.cellStart[c + 1] += grid.cellStart[c];
+  }
+
+  // Scatter in bulletOrder, which also sets the order within each cell; cellStart[c] is used as the write cursor
+  grid.cellBullets.resize(numEntries);
+  grid.entryX0.resize(numEntries);
+  grid.entryY0.resize(numEntries);
+  grid.entryX1.resize(numEntries);
+  grid.entryY1.resize(numEntries);
+  grid.entryOwner.resize(numEntries);
+  grid.entryIndex.resize(numEntries);
+  grid.entryFirst.resize(numEntries);
+  grid.entryLayer.resize(numEntries);
+  for (int i : grid.bulletOrder) {
+    CellRange& range = grid.bulletCells[i];
+    BulletData& bullet = bulletArray[i];
+    for (int cy = range.y0; cy <= range.y1; ++cy) {
+      for (int cx = range.x0; cx <= range.x1; ++cx) {
+        int entry = grid.cellStart[cy * grid.width + cx]++;
+        grid.cellBullets[entry] = i;
+        grid.entryX0[entry] = bullet.x0;
+        grid.entryY0[entry] = bullet.y0;
+        grid.entryX1[entry] = bullet.x1;
+        grid.entryY1[entry] = bullet.y1;
+        grid.entryOwner[entry] = bullet.unitOwner;
+        grid.entryIndex[entry] = bullet.bulletIndex;
+        grid.entryFirst[entry] = (cx == range.x0 ? FIRST_COLUMN : 0) | (cy == range.y0 ? FIRST_ROW : 0);
+        grid.entryLayer[entry] = bulletLayer[i];
+      }
     }
   }
 
-  // Estimate size and reserve space
-  std::vector<double> collisionsList;
-  collisionsList.reserve(numBullets * 2); // Assuming at most 2 collisions per bullet on average
+  // The cursors ended one cell ahead, shift them back
+  for (int c = numCells; c > 0; --c) {
+    grid.cellStart[c] = grid.cellStart[c - 1];
+  }
+  grid.cellStart[0] = 0;
+}
 
-  for (int i = 0; i < numBullets; ++i) {
-    BulletData& currentBullet = bulletArray[i];
-    if (!currentBullet.isActive) continue;
+// Records an overlapping pair of cell entries as the buffer slots of their bullets
+// A pair sharing several cells is only kept in the cell holding the overlap's top-left corner,
+// which is the one cell that is the first column and first row of at least one of the two bullets
+inline void emitPair(int a, int b, ArenaVector<int>& out) {
+  if ((grid.entryFirst[a] | grid.entryFirst[b]) != FIRST_BOTH) { return; }
+  out.push_back(grid.cellBullets[a]);
+  out.push_back(grid.cellBullets[b]);
+}
 
-    int gx = getGridX(currentBullet.x0);
-    int gy = getGridY(currentBullet.y0);
+inline bool entriesCollide(int a, int b) {
+  return
+    (grid.entryOwner[a] != grid.entryOwner[b]) &
+    (grid.entryIndex[a] != grid.entryIndex[b]) &
+    (grid.entryX1[a] >= grid.entryX0[b]) &
+    (grid.entryX0[a] <= grid.entryX1[b]) &
+    (grid.entryY1[a] >= grid.entryY0[b]) &
+    (grid.entryY0[a] <= grid.entryY1[b]);
+}
 
-    // Check the current cell and neighboring cells
-    for (int dx = -1; dx <= 1; dx++) {
+// Tests entry a against the candidate entries [first, last), appending collisions to out
+void testEntryScalar(int a, int first, int last, ArenaVector<int>& out) {
+  for (int b = first; b < last; ++b) {
+    if (entriesCollide(a, b)) { emitPair(a, b, out); }
+  }
+}
 
-      for (int dy = -1; dy <= 1; dy++) {
+// Narrow phase counters of one band, or of the whole grid on a single thread
+struct NarrowStats {
+  long long candidates = 0;   // Entry pairs tested
+  long long ownerRejects = 0; // Of those, pairs sharing an owner
+};
 
-        auto rowIt = grid.find(gx + dx);
-        if (rowIt == grid.end()) { continue; }
+// Counts the candidates entry a is about to be tested against
+inline void countCandidates(int a, int first, int last, NarrowStats* stats) {
+  stats->candidates += last - first;
+  for (int b = first; b < last; ++b) {
+    stats->ownerRejects += (grid.entryOwner[a] == grid.entryOwner[b]);
+  }
+}
 
-        auto cellIt = rowIt->second.find(gy + dy);
-        if (cellIt == rowIt->second.end()) { continue; }
+const int SMALL_CELL_ENTRIES = 8; // With layers, cells up to this size test their pairs one by one
 
-        GridCell& cell = cellIt->second;
-        cell.bullets.reserve(2); // Assuming an average of 2 bullets per cell
+// Narrow phase over cells [firstCell, lastCell), appending collisions to out
+// Every overlapping pair shares at least one cell, so testing pairs within each cell finds them all
+// Only the layer buckets of a cell that interact are tested against each other, one run of adjacent buckets at a time
+// The CountStats instantiation also fills stats, the other one never touches it
+template <void (*TestEntry)(int a, int first, int last, ArenaVector<int>& out), bool CountStats>
+void collideCellsWith(int firstCell, int lastCell, ArenaVector<int>& out, NarrowStats* stats) {
+  int bucketStart[MAX_LAYERS + 1];
+  for (int cell = firstCell; cell < lastCell; ++cell) {
+    int cellEnd = grid.cellStart[cell + 1];
+    if (cellEnd - grid.cellStart[cell] < 2) { continue; }
 
-        for (BulletData* targetBullet : cell.bullets) {
+    // In a cell this small, checking each pair's layers costs less than finding the buckets, and gives the same order
+    if (numLayers > 1 && cellEnd - grid.cellStart[cell] <= SMALL_CELL_ENTRIES) {
+      for (int a = grid.cellStart[cell]; a < cellEnd; ++a) {
+        uint32_t blocked = layerBlocked[grid.entryLayer[a]];
+        for (int b = a + 1; b < cellEnd; ++b) {
+          if ((blocked >> grid.entryLayer[b]) & 1) { continue; }
+          if constexpr (CountStats) { countCandidates(a, b, b + 1, stats); }
+          if (entriesCollide(a, b)) { emitPair(a, b, out); }
+        }
+      }
+      continue;
+    }
 
-          if (targetBullet->bulletIndex <= currentBullet.bulletIndex) { continue; }
-          if (!targetBullet->isActive) { continue; }
+    // Entries are in layer order, so the buckets are found in one pass
+    int e = grid.cellStart[cell];
+    for (int layer = 0; layer < numLayers; ++layer) {
+      bucketStart[layer] = e;
+      while (e < cellEnd && grid.entryLayer[e] == layer) { e++; }
+    }
+    bucketStart[numLayers] = cellEnd;
 
-          if (
-            currentBullet.unitOwner != targetBullet->unitOwner &&
-            currentBullet.x1 >= targetBullet->x0 &&
-            currentBullet.x0 <= targetBullet->x1 &&
-            currentBullet.y1 >= targetBullet->y0 &&
-            currentBullet.y0 <= targetBullet->y1
-            ) {
-            // Register the collision in the list
-            collisionsList.push_back(currentBullet.bulletIndex);
-            collisionsList.push_back(targetBullet->bulletIndex);
+    for (int layer = 0; layer < numLayers; ++layer) {
+      int bucketEnd = bucketStart[layer + 1];
+      if (bucketStart[layer] == bucketEnd) { continue; }
+      const LayerRun* runs = layerRuns[layer];
+      int numRuns = layerRunCount[layer];
 
-          }
+      for (int a = bucketStart[layer]; a < bucketEnd; ++a) {
+        for (int run = 0; run < numRuns; ++run) {
+          // Within its own bucket an entry is only tested against the ones after it
+          int first = (runs[run].first == layer) ? a + 1 : bucketStart[runs[run].first];
+          int last = bucketStart[runs[run].last + 1];
+          if constexpr (CountStats) { countCandidates(a, first, last, stats); }
+          TestEntry(a, first, last, out);
         }
       }
     }
   }
+}
+
+#ifdef COLLIDE_HAS_AVX2
+// Same as testEntryScalar, testing 4 candidates per step
+TARGET_AVX2 void testEntryAVX2(int a, int first, int last, ArenaVector<int>& out) {
+  const double* x0 = grid.entryX0.data();
+  const double* y0 = grid.entryY0.data();
+  const double* x1 = grid.entryX1.data();
+  const double* y1 = grid.entryY1.data();
+  const double* owner = grid.entryOwner.data();
+  const double* index = grid.entryIndex.data();
+
+  __m256d ax0 = _mm256_set1_pd(x0[a]);
+  __m256d ay0 = _mm256_set1_pd(y0[a]);
+  __m256d ax1 = _mm256_set1_pd(x1[a]);
+  __m256d ay1 = _mm256_set1_pd(y1[a]);
+  __m256d aOwner = _mm256_set1_pd(owner[a]);
+  __m256d aIndex = _mm256_set1_pd(index[a]);
+
+  int b = first;
+  for (; b + 4 <= last; b += 4) {
+    __m256d mask = _mm256_and_pd(
+      _mm256_cmp_pd(ax1, _mm256_loadu_pd(x0 + b), _CMP_GE_OQ),
+      _mm256_cmp_pd(ax0, _mm256_loadu_pd(x1 + b), _CMP_LE_OQ));
+    mask = _mm256_and_pd(mask, _mm256_cmp_pd(ay1, _mm256_loadu_pd(y0 + b), _CMP_GE_OQ));
+    mask = _mm256_and_pd(mask, _mm256_cmp_pd(ay0, _mm256_loadu_pd(y1 + b), _CMP_LE_OQ));
+    mask = _mm256_and_pd(mask, _mm256_cmp_pd(aOwner, _mm256_loadu_pd(owner + b), _CMP_NEQ_UQ));
+    mask = _mm256_and_pd(mask, _mm256_cmp_pd(aIndex, _mm256_loadu_pd(index + b), _CMP_NEQ_UQ));
+
+    int hits = _mm256_movemask_pd(mask);
+    if (hits == 0) { continue; }
+    for (int lane = 0; lane < 4; ++lane) {
+      if (hits & (1 << lane)) { emitPair(a, b + lane, out); }
+    }
+  }
+
+  // Leftover candidates
+  testEntryScalar(a, b, last, out);
+}
+
+bool cpuHasAVX2() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) { return false; }
+  __cpuid(info, 1);
+  bool osUsesXSave = (info[2] & (1 << 27)) != 0;
+  bool hasAVX = (info[2] & (1 << 28)) != 0;
+  if (!osUsesXSave || !hasAVX) { return false; }
+  if ((_xgetbv(0) & 6) != 6) { return false; } // OS saves the YMM registers
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+using CollideCellsFn = void (*)(int firstCell, int lastCell, ArenaVector<int>& out, NarrowStats* stats);
+
+// Narrow phase kernels, chosen once when the DLL loads; the counted one runs while stats are enabled
+#ifdef COLLIDE_HAS_AVX2
+CollideCellsFn collideCells = cpuHasAVX2() ? collideCellsWith<testEntryAVX2, false> : collideCellsWith<testEntryScalar, false>;
+CollideCellsFn collideCellsCounted = cpuHasAVX2() ? collideCellsWith<testEntryAVX2, true> : collideCellsWith<testEntryScalar, true>;
+#else
+CollideCellsFn collideCells = collideCellsWith<testEntryScalar, false>;
+CollideCellsFn collideCellsCounted = collideCellsWith<testEntryScalar, true>;
+#endif
+
+const int STATS_HISTOGRAM_BINS = 16;
+
+// Profiling counters of the last collision call, only filled while statsEnabled is set
+// The grid counters stay zero when another broadphase is selected
+struct CollisionStats {
+  double buildMs, queryMs;     // Grid build, and the narrow phase (or the whole sweep / tree pass) with the call's own pair test
+  double totalCells, occupiedCells, maxCellLoad;
+  double candidates, ownerRejects, emitted; // emitted counts the pairs the call reports, after its own pair test
+  double occupancy[STATS_HISTOGRAM_BINS]; // Bin b counts occupied cells holding 2^b to 2^(b+1) - 1 entries
+};
+CollisionStats collisionStats = {};
+bool statsEnabled = false;
+
+using StatsClock = std::chrono::steady_clock;
+
+double millisecondsSince(StatsClock::time_point start) {
+  return std::chrono::duration<double, std::milli>(StatsClock::now() - start).count();
+}
+
+// Cell load figures of the grid that was just built
+void measureOccupancy() {
+  int numCells = grid.width * grid.height;
+  collisionStats.totalCells = numCells;
+  for (int cell = 0; cell < numCells; ++cell) {
+    int load = grid.cellStart[cell + 1] - grid.cellStart[cell];
+    if (load == 0) { continue; }
+    int bin = 0;
+    while (bin < STATS_HISTOGRAM_BINS - 1 && (load >> (bin + 1)) != 0) { bin++; }
+    collisionStats.occupiedCells++;
+    collisionStats.occupancy[bin]++;
+    collisionStats.maxCellLoad = std::max(collisionStats.maxCellLoad, (double)load);
+  }
+}
+
+void addNarrowStats(const NarrowStats& stats) {
+  collisionStats.candidates += (double)stats.candidates;
+  collisionStats.ownerRejects += (double)stats.ownerRejects;
+}
+
+// Colliding pairs found this call, as buffer slots, two per pair
+// Reserved at the previous call's size, which is usually close, so it rarely regrows
+ArenaVector<int> collisionSlots = makeArenaVector<int>(frameArena);
+size_t collisionSlotsHint = 0;
+
+const int BANDS_PER_THREAD = 4;         // More bands than threads so uneven bands even out
+const int MIN_ENTRIES_PER_THREAD = 2048; // Below this, waking the workers costs more than it saves
+
+// Persistent worker threads running one job over a numbered set of tasks
+// The calling thread takes tasks as well, so a pool of size N has N - 1 workers
+struct WorkerPool {
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake, finished;
+  void (*job)(int task) = nullptr;
+  int numTasks = 0;
+  std::atomic<int> nextTask{ 0 };
+  int busyWorkers = 0;
+  unsigned long long generation = 0;
+  bool stopping = false;
+
+  int size() const { return (int)workers.size() + 1; }
+
+  void runTasks() {
+    for (int task = nextTask++; task < numTasks; task = nextTask++) {
+      job(task);
+    }
+  }
+
+  // seen starts at the generation the worker was created in, so it doesn't rerun an earlier job
+  void workerLoop(unsigned long long seen) {
+    while (true) {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || generation != seen; });
+      if (stopping) { return; }
+      seen = generation;
+      lock.unlock();
 
-  std::copy(collisionsList.begin(), collisionsList.end(), bulletCollisionsOut);
+      runTasks();
+
+      lock.lock();
+      if (--busyWorkers == 0) { finished.notify_one(); }
+    }
+  }
+
+  // Runs job(0) .. job(tasks - 1) across the pool and returns once all of them are done
+  void run(void (*newJob)(int task), int tasks) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = newJob;
+      numTasks = tasks;
+      nextTask = 0;
+      busyWorkers = (int)workers.size();
+      generation++;
+    }
+    wake.notify_all();
+
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return busyWorkers == 0; });
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) { worker.join(); }
+    workers.clear();
+    stopping = false;
+  }
+
+  void resize(int threads) {
+    stop();
+    for (int i = 1; i < threads; ++i) {
+      workers.emplace_back(&WorkerPool::workerLoop, this, generation);
+    }
+  }
+
+  ~WorkerPool() { stop(); }
+};
+WorkerPool workerPool;
+
+// Bands of whole grid rows, each with its own collision buffer, concatenated in band order
+// Each band draws from its own arena so workers never share an allocator
+ArenaVector<int> bandFirstCell = makeArenaVector<int>(frameArena);
+std::vector<std::unique_ptr<FrameArena>> bandArenas;
+std::vector<ArenaVector<int>> bandCollisions;
+std::vector<NarrowStats> bandStats;
+
+void collideBand(int band) {
+  bandArenas[band]->reset();
+  bandCollisions[band] = makeArenaVector<int>(*bandArenas[band]);
+  if (statsEnabled) {
+    bandStats[band] = NarrowStats();
+    collideCellsCounted(bandFirstCell[band], bandFirstCell[band + 1], bandCollisions[band], &bandStats[band]);
+  } else {
+    collideCells(bandFirstCell[band], bandFirstCell[band + 1], bandCollisions[band], nullptr);
+  }
+}
+
+// Splits the rows into bands holding roughly the same number of cell entries
+void splitBands(int numBands) {
+  bandFirstCell.resize(numBands + 1);
+  while (bandArenas.size() < (size_t)numBands) {
+    bandArenas.push_back(std::make_unique<FrameArena>());
+    bandCollisions.push_back(makeArenaVector<int>(*bandArenas.back()));
+    bandStats.emplace_back();
+  }
+
+  long long totalEntries = grid.cellStart[grid.width * grid.height];
+  int row = 0;
+  bandFirstCell[0] = 0;
+  for (int band = 1; band < numBands; ++band) {
+    long long target = totalEntries * band / numBands;
+    while (row < grid.height && grid.cellStart[row * grid.width] < target) { row++; }
+    bandFirstCell[band] = row * grid.width;
+  }
+  bandFirstCell[numBands] = grid.width * grid.height;
+}
+
+// Finds all colliding pairs with the grid and appends them to collisionSlots
+void collideGrid(BulletData* bulletArray, int count) {
+  // Populate the grid with bullets
+  StatsClock::time_point start;
+  if (statsEnabled) { start = StatsClock::now(); }
+  buildGrid(bulletArray, count);
+  if (statsEnabled) {
+    collisionStats.buildMs = millisecondsSince(start);
+    measureOccupancy();
+    start = StatsClock::now();
+  }
+
+  int numCells = grid.width * grid.height;
+  int numEntries = (numCells > 0) ? grid.cellStart[numCells] : 0;
+  int threads = std::min(workerPool.size(), numEntries / MIN_ENTRIES_PER_THREAD);
+
+  if (threads <= 1) {
+    if (statsEnabled) {
+      NarrowStats stats;
+      collideCellsCounted(0, numCells, collisionSlots, &stats);
+      addNarrowStats(stats);
+      collisionStats.queryMs = millisecondsSince(start);
+    } else {
+      collideCells(0, numCells, collisionSlots, nullptr);
+    }
+    return;
+  }
+
+  // Each pair is reported from exactly one cell, so concatenating the bands in order
+  // gives the same output as the single-threaded pass
+  int numBands = threads * BANDS_PER_THREAD;
+  splitBands(numBands);
+  workerPool.run(collideBand, numBands);
+
+  for (int band = 0; band < numBands; ++band) {
+    collisionSlots.insert(collisionSlots.end(), bandCollisions[band].begin(), bandCollisions[band].end());
+    if (statsEnabled) { addNarrowStats(bandStats[band]); }
+  }
+  if (statsEnabled) { collisionStats.queryMs = millisecondsSince(start); }
+}
+
+enum Broadphase {
+  BROADPHASE_GRID = 0,
+  BROADPHASE_SWEEP = 1,
+  BROADPHASE_TREE = 2
+};
+int broadphaseMode = BROADPHASE_GRID;
+
+const int SWEEP_SHIFTS_PER_BULLET = 8; // Insertion sort gives up and does a full sort past this many shifts
+
+// One entry of the sweep and prune list, sorted by minX
+// The entry keeps its bullet's buffer slot, so last frame's order is the starting point for this one
+struct SweepEntry {
+  double minX, maxX;
+  int slot;
+};
+std::vector<SweepEntry> sweepList;
+
+// Insertion sort, which is close to linear when the list is still almost sorted from last frame
+void sortSweepList() {
+  long long shiftBudget = (long long)sweepList.size() * SWEEP_SHIFTS_PER_BULLET + 64;
+  auto byMinX = [](const SweepEntry& a, const SweepEntry& b) { return a.minX < b.minX; };
+
+  for (size_t i = 1; i < sweepList.size(); ++i) {
+    SweepEntry entry = sweepList[i];
+    size_t j = i;
+    while (j > 0 && sweepList[j - 1].minX > entry.minX) {
+      sweepList[j] = sweepList[j - 1];
+      j--;
+      if (--shiftBudget < 0) {
+        // The order changed too much since last frame
+        sweepList[j] = entry;
+        std::sort(sweepList.begin(), sweepList.end(), byMinX);
+        return;
+      }
+    }
+    sweepList[j] = entry;
+  }
+}
+
+// Finds all colliding pairs with sweep and prune along x and appends them to collisionSlots
+void collideSweep(BulletData* bulletArray, int count) {
+  // Drop slots past the end of the buffer and add new ones at the back, where the sort will pick them up
+  int known = 0;
+  for (size_t i = 0; i < sweepList.size(); ++i) {
+    if (sweepList[i].slot < count) { sweepList[known++] = sweepList[i]; }
+  }
+  sweepList.resize(known);
+  for (int slot = known; slot < count; ++slot) {
+    sweepList.push_back(SweepEntry{ 0.0, 0.0, slot });
+  }
+
+  // Refresh the endpoints; inactive bullets sort to the back and end the sweep
+  for (SweepEntry& entry : sweepList) {
+    BulletData& bullet = bulletArray[entry.slot];
+    bool usable = bullet.isActive && !std::isnan(bullet.x0);
+    entry.minX = usable ? bullet.x0 : INFINITY;
+    entry.maxX = bullet.x1;
+  }
+  sortSweepList();
+
+  for (size_t i = 0; i < sweepList.size(); ++i) {
+    if (sweepList[i].minX == INFINITY) { break; }
+    BulletData& currentBullet = bulletArray[sweepList[i].slot];
+    double maxX = sweepList[i].maxX;
+
+    for (size_t j = i + 1; j < sweepList.size() && sweepList[j].minX <= maxX; ++j) {
+      BulletData& targetBullet = bulletArray[sweepList[j].slot];
+
+      if (
+        layersInteract(sweepList[i].slot, sweepList[j].slot) &&
+        currentBullet.unitOwner != targetBullet.unitOwner &&
+        currentBullet.bulletIndex != targetBullet.bulletIndex &&
+        currentBullet.x0 <= targetBullet.x1 &&
+        currentBullet.y1 >= targetBullet.y0 &&
+        currentBullet.y0 <= targetBullet.y1
+        ) {
+        // Register the collision in the list
+        collisionSlots.push_back(sweepList[i].slot);
+        collisionSlots.push_back(sweepList[j].slot);
+      }
+    }
+  }
+}
+
+const double TREE_FAT_MARGIN = 8.0; // Pixels added around each leaf, so slow bullets rarely need reinserting
+
+// Node of the dynamic AABB tree
+struct TreeNode {
+  double x0, y0, x1, y1; // Fattened box on leaves, union of the children otherwise
+  int parent;            // Next free node while on the free list
+  int child1, child2;    // -1 on leaves
+  int height;            // 0 on leaves
+  int slot;              // Buffer slot of the leaf's bullet
+
+  bool isLeaf() const { return child1 == -1; }
+};
+
+double perimeter(const TreeNode& node) {
+  return 2.0 * ((node.x1 - node.x0) + (node.y1 - node.y0));
+}
+
+double unionPerimeter(const TreeNode& a, const TreeNode& b) {
+  return 2.0 * ((std::max(a.x1, b.x1) - std::min(a.x0, b.x0)) + (std::max(a.y1, b.y1) - std::min(a.y0, b.y0)));
+}
+
+void setUnion(TreeNode& node, const TreeNode& a, const TreeNode& b) {
+  node.x0 = std::min(a.x0, b.x0);
+  node.y0 = std::min(a.y0, b.y0);
+  node.x1 = std::max(a.x1, b.x1);
+  node.y1 = std::max(a.y1, b.y1);
+}
+
+// Incremental bounding volume hierarchy over bullet slots, kept between calls
+// Leaves are only reinserted when their bullet leaves the fattened box, and every
+// insert or removal rebalances the path to the root with tree rotations
+struct AABBTree {
+  std::vector<TreeNode> nodes;
+  int root = -1;
+  int freeList = -1;
+  std::vector<int> slotLeaf; // Leaf node of each buffer slot, -1 when not in the tree
+  std::vector<int> stack;    // Traversal stack, reused between queries
+
+  int allocateNode() {
+    if (freeList == -1) {
+      nodes.push_back(TreeNode{});
+      freeList = (int)nodes.size() - 1;
+      nodes[freeList].parent = -1;
+    }
+    int node = freeList;
+    freeList = nodes[node].parent;
+    nodes[node].parent = -1;
+    nodes[node].child1 = nodes[node].child2 = -1;
+    nodes[node].height = 0;
+    nodes[node].slot = -1;
+    return node;
+  }
+
+  void freeNode(int node) {
+    nodes[node].parent = freeList;
+    nodes[node].height = -1;
+    freeList = node;
+  }
+
+  // Rotates the taller grandchild up when node's children differ in height by more than 1
+  // Returns the node now at node's place in the tree
+  int balance(int iA) {
+    TreeNode& A = nodes[iA];
+    if (A.isLeaf() || A.height < 2) { return iA; }
+
+    int iB = A.child1;
+    int iC = A.child2;
+    TreeNode& B = nodes[iB];
+    TreeNode& C = nodes[iC];
+    int heightDifference = C.height - B.height;
+
+    if (heightDifference > 1) {
+      // Rotate C up
+      int iF = C.child1;
+      int iG = C.child2;
+      TreeNode& F = nodes[iF];
+      TreeNode& G = nodes[iG];
+
+      C.child1 = iA;
+      C.parent = A.parent;
+      A.parent = iC;
+      if (C.parent != -1) {
+        (nodes[C.parent].child1 == iA ? nodes[C.parent].child1 : nodes[C.parent].child2) = iC;
+      } else {
+        root = iC;
+      }
+
+      if (F.height > G.height) {
+        C.child2 = iF;
+        A.child2 = iG;
+        G.parent = iA;
+        setUnion(A, B, G);
+        setUnion(C, A, F);
+        A.height = 1 + std::max(B.height, G.height);
+        C.height = 1 + std::max(A.height, F.height);
+      } else {
+        C.child2 = iG;
+        A.child2 = iF;
+        F.parent = iA;
+        setUnion(A, B, F);
+        setUnion(C, A, G);
+        A.height = 1 + std::max(B.height, F.height);
+        C.height = 1 + std::max(A.height, G.height);
+      }
+      return iC;
+    }
+
+    if (heightDifference < -1) {
+      // Rotate B up
+      int iD = B.child1;
+      int iE = B.child2;
+      TreeNode& D = nodes[iD];
+      TreeNode& E = nodes[iE];
+
+      B.child1 = iA;
+      B.parent = A.parent;
+      A.parent = iB;
+      if (B.parent != -1) {
+        (nodes[B.parent].child1 == iA ? nodes[B.parent].child1 : nodes[B.parent].child2) = iB;
+      } else {
+        root = iB;
+      }
+
+      if (D.height > E.height) {
+        B.child2 = iD;
+        A.child1 = iE;
+        E.parent = iA;
+        setUnion(A, C, E);
+        setUnion(B, A, D);
+        A.height = 1 + std::max(C.height, E.height);
+        B.height = 1 + std::max(A.height, D.height);
+      } else {
+        B.child2 = iE;
+        A.child1 = iD;
+        D.parent = iA;
+        setUnion(A, C, D);
+        setUnion(B, A, E);
+        A.height = 1 + std::max(C.height, D.height);
+        B.height = 1 + std::max(A.height, E.height);
+      }
+      return iB;
+    }
+
+    return iA;
+  }
+
+  // Refits boxes and heights from node up to the root, rebalancing on the way
+  void refitFrom(int node) {
+    while (node != -1) {
+      node = balance(node);
+      TreeNode& current = nodes[node];
+      setUnion(current, nodes[current.child1], nodes[current.child2]);
+      current.height = 1 + std::max(nodes[current.child1].height, nodes[current.child2].height);
+      node = current.parent;
+    }
+  }
+
+  void insertLeaf(int leaf) {
+    if (root == -1) {
+      root = leaf;
+      nodes[root].parent = -1;
+      return;
+    }
+
+    // Walk down to the sibling that grows the total perimeter the least
+    int index = root;
+    while (!nodes[index].isLeaf()) {
+      const TreeNode& node = nodes[index];
+      const TreeNode& leafNode = nodes[leaf];
+      double combinedPerimeter = unionPerimeter(node, leafNode);
+
+      double cost = 2.0 * combinedPerimeter;
+      double inheritanceCost = 2.0 * (combinedPerimeter - perimeter(node));
+
+      auto descendCost = [&](const TreeNode& child) {
+        double grown = unionPerimeter(child, leafNode);
+        return (child.isLeaf() ? grown : grown - perimeter(child)) + inheritanceCost;
+      };
+      double cost1 = descendCost(nodes[node.child1]);
+      double cost2 = descendCost(nodes[node.child2]);
+
+      if (cost < cost1 && cost < cost2) { break; }
+      index = (cost1 < cost2) ? node.child1 : node.child2;
+    }
+    int sibling = index;
+
+    // New parent takes the sibling's place
+    int oldParent = nodes[sibling].parent;
+    int newParent = allocateNode();
+    nodes[newParent].parent = oldParent;
+    nodes[newParent].child1 = sibling;
+    nodes[newParent].child2 = leaf;
+    nodes[newParent].height = nodes[sibling].height + 1;
+    setUnion(nodes[newParent], nodes[sibling], nodes[leaf]);
+    nodes[sibling].parent = newParent;
+    nodes[leaf].parent = newParent;
+
+    if (oldParent != -1) {
+      (nodes[oldParent].child1 == sibling ? nodes[oldParent].child1 : nodes[oldParent].child2) = newParent;
+    } else {
+      root = newParent;
+    }
+
+    refitFrom(oldParent);
+  }
+
+  void removeLeaf(int leaf) {
+    if (leaf == root) {
+      root = -1;
+      return;
+    }
+
+    // The sibling takes the parent's place
+    int parent = nodes[leaf].parent;
+    int grandParent = nodes[parent].parent;
+    int sibling = (nodes[parent].child1 == leaf) ? nodes[parent].child2 : nodes[parent].child1;
+
+    nodes[sibling].parent = grandParent;
+    if (grandParent != -1) {
+      (nodes[grandParent].child1 == parent ? nodes[grandParent].child1 : nodes[grandParent].child2) = sibling;
+    } else {
+      root = sibling;
+    }
+    freeNode(parent);
+
+    refitFrom(grandParent);
+  }
+
+  void setFatBox(int leaf, const BulletData& bullet) {
+    nodes[leaf].x0 = bullet.x0 - TREE_FAT_MARGIN;
+    nodes[leaf].y0 = bullet.y0 - TREE_FAT_MARGIN;
+    nodes[leaf].x1 = bullet.x1 + TREE_FAT_MARGIN;
+    nodes[leaf].y1 = bullet.y1 + TREE_FAT_MARGIN;
+  }
+
+  void removeSlot(int slot) {
+    int leaf = slotLeaf[slot];
+    if (leaf == -1) { return; }
+    removeLeaf(leaf);
+    freeNode(leaf);
+    slotLeaf[slot] = -1;
+  }
+
+  // Brings the tree in line with this frame's buffer
+  void update(BulletData* bulletArray, int count) {
+    for (int slot = count; slot < (int)slotLeaf.size(); ++slot) {
+      removeSlot(slot);
+    }
+    slotLeaf.resize(count, -1);
+
+    for (int slot = 0; slot < count; ++slot) {
+      BulletData& bullet = bulletArray[slot];
+      bool usable = bullet.isActive && !std::isnan(bullet.x0) && !std::isnan(bullet.y0);
+      int leaf = slotLeaf[slot];
+
+      if (!usable) {
+        removeSlot(slot);
+        continue;
+      }
+
+      if (leaf == -1) {
+        leaf = allocateNode();
+        nodes[leaf].slot = slot;
+        setFatBox(leaf, bullet);
+        insertLeaf(leaf);
+        slotLeaf[slot] = leaf;
+        continue;
+      }
+
+      // Still inside its fattened box, nothing to do
+      const TreeNode& node = nodes[leaf];
+      if (node.x0 <= bullet.x0 && node.y0 <= bullet.y0 && bullet.x1 <= node.x1 && bullet.y1 <= node.y1) { continue; }
+
+      removeLeaf(leaf);
+      setFatBox(leaf, bullet);
+      insertLeaf(leaf);
+    }
+  }
+};
+AABBTree tree;
+
+// Finds all colliding pairs with the dynamic AABB tree and appends them to collisionSlots
+void collideTree(BulletData* bulletArray, int count) {
+  tree.update(bulletArray, count);
+
+  for (int slot = 0; slot < count; ++slot) {
+    if (tree.slotLeaf[slot] == -1) { continue; }
+    BulletData& currentBullet = bulletArray[slot];
+
+    tree.stack.clear();
+    tree.stack.push_back(tree.root);
+    while (!tree.stack.empty()) {
+      const TreeNode& node = tree.nodes[tree.stack.back()];
+      tree.stack.pop_back();
+
+      if (
+        currentBullet.x1 < node.x0 || currentBullet.x0 > node.x1 ||
+        currentBullet.y1 < node.y0 || currentBullet.y0 > node.y1
+        ) { continue; }
+
+      if (!node.isLeaf()) {
+        tree.stack.push_back(node.child1);
+        tree.stack.push_back(node.child2);
+        continue;
+      }
+
+      // Each pair is found from both sides, keep the one from the lower slot
+      if (node.slot <= slot) { continue; }
+      BulletData& targetBullet = bulletArray[node.slot];
+
+      if (
+        layersInteract(slot, node.slot) &&
+        currentBullet.unitOwner != targetBullet.unitOwner &&
+        currentBullet.bulletIndex != targetBullet.bulletIndex &&
+        currentBullet.x1 >= targetBullet.x0 &&
+        currentBullet.x0 <= targetBullet.x1 &&
+        currentBullet.y1 >= targetBullet.y0 &&
+        currentBullet.y0 <= targetBullet.y1
+        ) {
+        // Register the collision in the list
+        collisionSlots.push_back(slot);
+        collisionSlots.push_back(node.slot);
+      }
+    }
+  }
+}
+
+// Bullets of the last collision call, kept when the grid wasn't built from them
+std::vector<BulletData> indexedBullets;
+bool gridStale = false;
+
+// Fills collisionSlots with every colliding pair, using the selected broadphase
+void findCollisions(BulletData* bulletArray, int count) {
+  collisionSlots.clear();
+  collisionSlots.reserve(collisionSlotsHint);
+  assignLayers(bulletArray, count);
+
+  StatsClock::time_point start;
+  if (statsEnabled) {
+    collisionStats = {};
+    start = StatsClock::now();
+  }
+
+  if (broadphaseMode == BROADPHASE_SWEEP) {
+    collideSweep(bulletArray, count);
+  } else if (broadphaseMode == BROADPHASE_TREE) {
+    collideTree(bulletArray, count);
+  } else {
+    collideGrid(bulletArray, count);
+  }
+
+  if (statsEnabled) {
+    if (broadphaseMode != BROADPHASE_GRID) { collisionStats.queryMs = millisecondsSince(start); }
+    collisionStats.emitted = (double)(collisionSlots.size() / 2);
+  }
+
+  // The other broadphases leave the grid alone, so keep the bullets to build it from if a query needs it
+  gridStale = (broadphaseMode != BROADPHASE_GRID);
+  if (gridStale) { indexedBullets.assign(bulletArray, bulletArray + count); }
+  collisionSlotsHint = collisionSlots.size();
+}
+
+// For calls that test the pairs of findCollisions again, e.g. as rotated rectangles, starting at filterStart:
+// adds that test to the query time and counts only the pairs it kept as emitted
+void recordPairFilter(StatsClock::time_point filterStart, int kept) {
+  if (!statsEnabled) { return; }
+  collisionStats.queryMs += millisecondsSince(filterStart);
+  collisionStats.emitted = kept;
+}
+
+// Writes collisionSlots out as bullet indices, lower index first in each pair
+void writeCollisions(BulletData* bulletArray, double* out) {
+  for (size_t i = 0; i < collisionSlots.size(); i += 2) {
+    double indexA = bulletArray[collisionSlots[i]].bulletIndex;
+    double indexB = bulletArray[collisionSlots[i + 1]].bulletIndex;
+    *out++ = std::min(indexA, indexB);
+    *out++ = std::max(indexA, indexB);
+  }
+}
+
+// Oriented rectangles of the rotated call, one per buffer slot
+struct OrientedBoxes {
+  ArenaVector<double> centerX = makeArenaVector<double>(frameArena);
+  ArenaVector<double> centerY = makeArenaVector<double>(frameArena);
+  ArenaVector<double> axisX = makeArenaVector<double>(frameArena); // Unit vector along the rectangle's width
+  ArenaVector<double> axisY = makeArenaVector<double>(frameArena);
+  ArenaVector<double> halfWidth = makeArenaVector<double>(frameArena);
+  ArenaVector<double> halfHeight = makeArenaVector<double>(frameArena);
+};
+OrientedBoxes orientedBoxes;
+ArenaVector<BulletData> unpackedBullets = makeArenaVector<BulletData>(frameArena);
+
+// Separating axis test between the oriented rectangles of two slots
+// With B's axes written in A's frame, the four candidate axes only need |cos| and |sin| of the angle between them
+inline bool orientedBoxesOverlap(int a, int b) {
+  const OrientedBoxes& boxes = orientedBoxes;
+  double dx = boxes.centerX[b] - boxes.centerX[a];
+  double dy = boxes.centerY[b] - boxes.centerY[a];
+  double uax = boxes.axisX[a], uay = boxes.axisY[a];
+  double ubx = boxes.axisX[b], uby = boxes.axisY[b];
+  double cosine = std::fabs(uax * ubx + uay * uby);
+  double sine = std::fabs(uax * uby - uay * ubx);
+  double widthA = boxes.halfWidth[a], heightA = boxes.halfHeight[a];
+  double widthB = boxes.halfWidth[b], heightB = boxes.halfHeight[b];
+
+  return
+    std::fabs(dx * uax + dy * uay) <= widthA + widthB * cosine + heightB * sine &&
+    std::fabs(dy * uax - dx * uay) <= heightA + widthB * sine + heightB * cosine &&
+    std::fabs(dx * ubx + dy * uby) <= widthB + widthA * cosine + heightA * sine &&
+    std::fabs(dy * ubx - dx * uby) <= heightB + widthA * sine + heightA * cosine;
+}
+
+// Keeps the slot pairs from first onwards whose oriented rectangles overlap, compacting them after
+// the kept pairs already at the front; returns the new number of pairs kept
+int filterOrientedPairsFrom(int* pairs, int first, int kept, int numPairs) {
+  for (int p = first; p < numPairs; ++p) {
+    int a = pairs[2 * p], b = pairs[2 * p + 1];
+    if (!orientedBoxesOverlap(a, b)) { continue; }
+    pairs[2 * kept] = a;
+    pairs[2 * kept + 1] = b;
+    kept++;
+  }
+  return kept;
+}
+
+// Keeps the slot pairs whose oriented rectangles overlap, compacting them to the front
+// Returns the number of pairs kept
+int filterOrientedPairsScalar(int* pairs, int numPairs) {
+  return filterOrientedPairsFrom(pairs, 0, 0, numPairs);
+}
+
+#ifdef COLLIDE_HAS_AVX2
+TARGET_AVX2 inline __m256d absoluteAVX2(__m256d v) {
+  return _mm256_andnot_pd(_mm256_set1_pd(-0.0), v);
+}
+
+TARGET_AVX2 inline __m256d dotAVX2(__m256d ax, __m256d ay, __m256d bx, __m256d by) {
+  return _mm256_add_pd(_mm256_mul_pd(ax, bx), _mm256_mul_pd(ay, by));
+}
+
+TARGET_AVX2 inline __m256d crossAVX2(__m256d ax, __m256d ay, __m256d bx, __m256d by) {
+  return _mm256_sub_pd(_mm256_mul_pd(ax, by), _mm256_mul_pd(ay, bx));
+}
+
+// Projected radius of both rectangles on one axis
+TARGET_AVX2 inline __m256d radiusAVX2(__m256d own, __m256d width, __m256d height, __m256d first, __m256d second) {
+  return _mm256_add_pd(own, _mm256_add_pd(_mm256_mul_pd(width, first), _mm256_mul_pd(height, second)));
+}
+
+// Same as filterOrientedPairsScalar, testing 4 pairs per step
+TARGET_AVX2 int filterOrientedPairsAVX2(int* pairs, int numPairs) {
+  const OrientedBoxes& boxes = orientedBoxes;
+  const __m256i deinterleave = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+  int kept = 0;
+  int p = 0;
+  for (; p + 4 <= numPairs; p += 4) {
+    __m256i slots = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)(pairs + 2 * p)), deinterleave);
+    __m128i slotsA = _mm256_castsi256_si128(slots);
+    __m128i slotsB = _mm256_extracti128_si256(slots, 1);
+
+    __m256d dx = _mm256_sub_pd(_mm256_i32gather_pd(boxes.centerX.data(), slotsB, 8), _mm256_i32gather_pd(boxes.centerX.data(), slotsA, 8));
+    __m256d dy = _mm256_sub_pd(_mm256_i32gather_pd(boxes.centerY.data(), slotsB, 8), _mm256_i32gather_pd(boxes.centerY.data(), slotsA, 8));
+    __m256d uax = _mm256_i32gather_pd(boxes.axisX.data(), slotsA, 8);
+    __m256d uay = _mm256_i32gather_pd(boxes.axisY.data(), slotsA, 8);
+    __m256d ubx = _mm256_i32gather_pd(boxes.axisX.data(), slotsB, 8);
+    __m256d uby = _mm256_i32gather_pd(boxes.axisY.data(), slotsB, 8);
+    __m256d widthA = _mm256_i32gather_pd(boxes.halfWidth.data(), slotsA, 8);
+    __m256d heightA = _mm256_i32gather_pd(boxes.halfHeight.data(), slotsA, 8);
+    __m256d widthB = _mm256_i32gather_pd(boxes.halfWidth.data(), slotsB, 8);
+    __m256d heightB = _mm256_i32gather_pd(boxes.halfHeight.data(), slotsB, 8);
+
+    __m256d cosine = absoluteAVX2(dotAVX2(uax, uay, ubx, uby));
+    __m256d sine = absoluteAVX2(crossAVX2(uax, uay, ubx, uby));
+
+    __m256d separated = _mm256_cmp_pd(absoluteAVX2(dotAVX2(dx, dy, uax, uay)), radiusAVX2(widthA, widthB, heightB, cosine, sine), _CMP_GT_OQ);
+    separated = _mm256_or_pd(separated, _mm256_cmp_pd(absoluteAVX2(crossAVX2(uax, uay, dx, dy)), radiusAVX2(heightA, widthB, heightB, sine, cosine), _CMP_GT_OQ));
+    separated = _mm256_or_pd(separated, _mm256_cmp_pd(absoluteAVX2(dotAVX2(dx, dy, ubx, uby)), radiusAVX2(widthB, widthA, heightA, cosine, sine), _CMP_GT_OQ));
+    separated = _mm256_or_pd(separated, _mm256_cmp_pd(absoluteAVX2(crossAVX2(ubx, uby, dx, dy)), radiusAVX2(heightB, widthA, heightA, sine, cosine), _CMP_GT_OQ));
+
+    int overlapping = ~_mm256_movemask_pd(separated) & 15;
+    for (int lane = 0; lane < 4; ++lane) {
+      if (!(overlapping & (1 << lane))) { continue; }
+      int a = pairs[2 * (p + lane)], b = pairs[2 * (p + lane) + 1];
+      pairs[2 * kept] = a;
+      pairs[2 * kept + 1] = b;
+      kept++;
+    }
+  }
+
+  // Leftover pairs
+  return filterOrientedPairsFrom(pairs, p, kept, numPairs);
+}
+#endif
+
+// Separating axis filter, chosen once when the DLL loads
+#ifdef COLLIDE_HAS_AVX2
+int (*filterOrientedPairs)(int* pairs, int numPairs) = cpuHasAVX2() ? filterOrientedPairsAVX2 : filterOrientedPairsScalar;
+#else
+int (*filterOrientedPairs)(int* pairs, int numPairs) = filterOrientedPairsScalar;
+#endif
+
+// Copies the BulletData part of each rotated record and builds its oriented rectangle
+void unpackRotatedBullets(RotatedBulletData* records, int count) {
+  unpackedBullets.resize(count);
+  orientedBoxes.centerX.resize(count);
+  orientedBoxes.centerY.resize(count);
+  orientedBoxes.axisX.resize(count);
+  orientedBoxes.axisY.resize(count);
+  orientedBoxes.halfWidth.resize(count);
+  orientedBoxes.halfHeight.resize(count);
+
+  for (int i = 0; i < count; ++i) {
+    RotatedBulletData& record = records[i];
+    unpackedBullets[i] = BulletData{ record.x0, record.y0, record.x1, record.y1, record.isActive, record.unitOwner, record.bulletIndex };
+
+    orientedBoxes.centerX[i] = (record.x0 + record.x1) * 0.5;
+    orientedBoxes.centerY[i] = (record.y0 + record.y1) * 0.5;
+    if (record.halfWidth > 0.0 && record.halfHeight > 0.0) {
+      // GameMaker's y axis points down, so counterclockwise angles turn towards -y
+      double radians = record.angle * M_PI / 180.0;
+      orientedBoxes.axisX[i] = std::cos(radians);
+      orientedBoxes.axisY[i] = -std::sin(radians);
+      orientedBoxes.halfWidth[i] = record.halfWidth;
+      orientedBoxes.halfHeight[i] = record.halfHeight;
+    } else {
+      orientedBoxes.axisX[i] = 1.0;
+      orientedBoxes.axisY[i] = 0.0;
+      orientedBoxes.halfWidth[i] = (record.x1 - record.x0) * 0.5;
+      orientedBoxes.halfHeight[i] = (record.y1 - record.y0) * 0.5;
+    }
+  }
+}
+
+// Start-of-step bounds and velocity of each slot in the swept call
+ArenaVector<MovingBulletData> movingBullets = makeArenaVector<MovingBulletData>(frameArena);
+
+// Broadphase input for the swept call: each bullet's AABB grown to cover its whole path
+void unpackMovingBullets(MovingBulletData* records, int count) {
+  unpackedBullets.resize(count);
+  movingBullets.assign(records, records + count);
+
+  for (int i = 0; i < count; ++i) {
+    MovingBulletData& record = records[i];
+    unpackedBullets[i] = BulletData{
+      std::min(record.x0, record.x0 + record.speedX),
+      std::min(record.y0, record.y0 + record.speedY),
+      std::max(record.x1, record.x1 + record.speedX),
+      std::max(record.y1, record.y1 + record.speedY),
+      record.isActive, record.unitOwner, record.bulletIndex };
+  }
+}
+
+// Narrows [first, last] down to the times when two intervals overlap along one axis
+// The second interval moves at relative speed; returns false when the window becomes empty
+inline bool clipOverlapTime(double min0, double max0, double min1, double max1, double speed, double& first, double& last) {
+  if (speed == 0.0) {
+    return min0 <= max1 && min1 <= max0;
+  }
+  double enter = (min0 - max1) / speed;
+  double exit = (max0 - min1) / speed;
+  if (enter > exit) { std::swap(enter, exit); }
+  first = std::max(first, enter);
+  last = std::min(last, exit);
+  return first <= last;
+}
+
+// Earliest time in [0, 1] at which two moving boxes touch, or -1 if they stay apart for the whole step
+double timeOfImpact(const MovingBulletData& a, const MovingBulletData& b) {
+  double first = 0.0, last = 1.0;
+  if (!clipOverlapTime(a.x0, a.x1, b.x0, b.x1, b.speedX - a.speedX, first, last)) { return -1.0; }
+  if (!clipOverlapTime(a.y0, a.y1, b.y0, b.y1, b.speedY - a.speedY, first, last)) { return -1.0; }
+  return first;
+}
+
+// Builds the grid from the last collision call's bullets if that call used another broadphase
+void ensureQueryGrid() {
+  if (!gridStale) { return; }
+  assignLayers(indexedBullets.data(), (int)indexedBullets.size());
+  buildGrid(indexedBullets.data(), (int)indexedBullets.size());
+  gridStale = false;
+}
+
+CellRange queryCells(double x0, double y0, double x1, double y1) {
+  return CellRange{ getGridX(x0), getGridY(y0), getGridX(x1), getGridY(y1) };
+}
+
+// Calls visit(entry) once for every bullet with an entry in the cells of range, across all layers
+// A bullet covering several of those cells is only visited in the first column and row it shares with the range
+template <typename Visit>
+void forEachEntryIn(const CellRange& range, Visit visit) {
+  for (int cy = range.y0; cy <= range.y1; ++cy) {
+    for (int cx = range.x0; cx <= range.x1; ++cx) {
+      int cell = cy * grid.width + cx;
+      int end = grid.cellStart[cell + 1];
+      for (int e = grid.cellStart[cell]; e < end; ++e) {
+        bool firstColumn = (cx == range.x0) || (grid.entryFirst[e] & FIRST_COLUMN);
+        bool firstRow = (cy == range.y0) || (grid.entryFirst[e] & FIRST_ROW);
+        if (firstColumn && firstRow) { visit(e); }
+      }
+    }
+  }
+}
+
+CellRange queryBounds(const CircleQueryData& query) {
+  return queryCells(query.x - query.radius, query.y - query.radius, query.x + query.radius, query.y + query.radius);
+}
+
+CellRange queryBounds(const RectQueryData& query) {
+  return queryCells(query.x0, query.y0, query.x1, query.y1);
+}
+
+inline bool queryOverlaps(const CircleQueryData& query, int e) {
+  double dx = std::clamp(query.x, grid.entryX0[e], grid.entryX1[e]) - query.x;
+  double dy = std::clamp(query.y, grid.entryY0[e], grid.entryY1[e]) - query.y;
+  return dx * dx + dy * dy <= query.radius * query.radius;
+}
+
+inline bool queryOverlaps(const RectQueryData& query, int e) {
+  return
+    grid.entryX1[e] >= query.x0 && grid.entryX0[e] <= query.x1 &&
+    grid.entryY1[e] >= query.y0 && grid.entryY0[e] <= query.y1;
+}
+
+// Runs a batch of overlap queries against the grid, writing the CompactQueryHeader layout
+// Returns the number of indices written
+template <typename Query>
+int runOverlapQueries(const Query* queries, int numQueries, void* resultsOut, int capacity) {
+  CompactQueryHeader* header = reinterpret_cast<CompactQueryHeader*>(resultsOut);
+  int32_t* offsets = reinterpret_cast<int32_t*>(header + 1);
+  int32_t* indices = offsets + numQueries + 1;
+  ensureQueryGrid();
+
+  int found = 0, written = 0;
+  for (int q = 0; q < numQueries; ++q) {
+    offsets[q] = written;
+    const Query& query = queries[q];
+    if (grid.width == 0) { continue; }
+    forEachEntryIn(queryBounds(query), [&](int e) {
+      if (grid.entryOwner[e] == query.ignoreOwner || !queryOverlaps(query, e)) { return; }
+      found++;
+      if (written < capacity) { indices[written++] = (int32_t)grid.entryIndex[e]; }
+    });
+  }
+  offsets[numQueries] = written;
+
+  header->resultsFound = found;
+  header->flags = (found > written) ? COMPACT_OVERFLOW : 0;
+  return written;
+}
+
+// Slab test of a segment against an AABB; narrows [first, last] to the part inside the box
+inline bool clipSegment(double x0, double y0, double dx, double dy,
+  double minX, double minY, double maxX, double maxY, double& first, double& last) {
+  return
+    clipOverlapTime(minX, maxX, x0, x0, dx, first, last) &&
+    clipOverlapTime(minY, maxY, y0, y0, dy, first, last);
+}
+
+// First bullet hit by the segment, walking the grid cells it crosses in order until no closer hit is possible
+CompactRayHit raycastGrid(const RayQueryData& query) {
+  CompactRayHit hit{ -1, 0.0f };
+  if (grid.width == 0) { return hit; }
+
+  double dx = query.x1 - query.x0, dy = query.y1 - query.y0;
+  double gridMaxX = grid.originX + grid.width * grid.cellSize;
+  double gridMaxY = grid.originY + grid.height * grid.cellSize;
+  double start = 0.0, end = 1.0;
+  if (!clipSegment(query.x0, query.y0, dx, dy, grid.originX, grid.originY, gridMaxX, gridMaxY, start, end)) { return hit; }
+
+  int cx = getGridX(query.x0 + dx * start);
+  int cy = getGridY(query.y0 + dy * start);
+  int stepX = (dx > 0.0) ? 1 : -1;
+  int stepY = (dy > 0.0) ? 1 : -1;
+  double boundaryX = grid.originX + (cx + (dx > 0.0 ? 1 : 0)) * grid.cellSize;
+  double boundaryY = grid.originY + (cy + (dy > 0.0 ? 1 : 0)) * grid.cellSize;
+  double nextX = (dx != 0.0) ? (boundaryX - query.x0) / dx : INFINITY;
+  double nextY = (dy != 0.0) ? (boundaryY - query.y0) / dy : INFINITY;
+  double deltaX = (dx != 0.0) ? grid.cellSize / std::fabs(dx) : INFINITY;
+  double deltaY = (dy != 0.0) ? grid.cellSize / std::fabs(dy) : INFINITY;
+
+  double best = INFINITY;
+  int bestEntry = -1;
+  while (true) {
+    int cell = cy * grid.width + cx;
+    int cellEnd = grid.cellStart[cell + 1];
+    for (int e = grid.cellStart[cell]; e < cellEnd; ++e) {
+      if (grid.entryOwner[e] == query.ignoreOwner) { continue; }
+      double first = 0.0, last = 1.0;
+      if (!clipSegment(query.x0, query.y0, dx, dy, grid.entryX0[e], grid.entryY0[e], grid.entryX1[e], grid.entryY1[e], first, last)) { continue; }
+      if (first < best) {
+        best = first;
+        bestEntry = e;
+      }
+    }
+
+    // Hits found so far are closer than anything in the cells further along
+    double cellExit = std::min(nextX, nextY);
+    if (best <= cellExit || cellExit > end) { break; }
+    if (nextX < nextY) {
+      cx += stepX;
+      nextX += deltaX;
+    } else {
+      cy += stepY;
+      nextY += deltaY;
+    }
+    if (cx < 0 || cx >= grid.width || cy < 0 || cy >= grid.height) { break; }
+  }
+
+  if (bestEntry >= 0) {
+    hit.bulletIndex = (int32_t)grid.entryIndex[bestEntry];
+    hit.distance = (float)(best * std::sqrt(dx * dx + dy * dy));
+  }
+  return hit;
+}
+
+// Broadphase input for the compact call
+void unpackCompactBullets(CompactBulletData* records, int count) {
+  unpackedBullets.resize(count);
+
+  for (int i = 0; i < count; ++i) {
+    CompactBulletData& record = records[i];
+    unpackedBullets[i] = BulletData{
+      record.x0, record.y0, record.x1, record.y1,
+      (record.flags & COMPACT_ACTIVE) ? 1.0 : 0.0,
+      (double)record.unitOwner, (double)record.bulletIndex };
+  }
+}
+
+// Bullets owned by the DLL, stored as structure-of-arrays in slots 0 .. count - 1
+// Despawning moves the last bullet into the freed slot; ids stay stable and are what events report
+struct BulletWorld {
+  int count = 0;
+  std::vector<double> x, y;                // Center
+  std::vector<double> speedX, speedY;      // Pixels per step
+  std::vector<double> angle, axisX, axisY; // Degrees, and the unit vector along the width
+  std::vector<double> halfWidth, halfHeight;
+  std::vector<double> owner;
+  std::vector<double> lifetime;            // Steps left, infinity when the bullet never expires
+  std::vector<int> id;
+  std::vector<int> slotOfId;               // -1 for ids not in use
+  std::vector<int> freeIds;
+};
+BulletWorld world;
+
+// Record of the world spawn call
+struct WorldSpawnData {
+  double x, y, speedX, speedY;
+  double angle;                 // Degrees, counterclockwise like image_angle
+  double halfWidth, halfHeight; // Of the unrotated rectangle
+  double unitOwner;
+  double lifetime;              // Steps until the bullet expires, 0 or less never expires
+};
+
+// Record of the world update call; the bullet keeps its size, owner and lifetime
+struct WorldUpdateData {
+  double id, x, y, speedX, speedY, angle;
+};
+
+void setWorldAngle(int slot, double angle) {
+  // GameMaker's y axis points down, so counterclockwise angles turn towards -y
+  double radians = angle * M_PI / 180.0;
+  world.angle[slot] = angle;
+  world.axisX[slot] = std::cos(radians);
+  world.axisY[slot] = -std::sin(radians);
+}
+
+void resizeWorld(int size) {
+  world.x.resize(size);
+  world.y.resize(size);
+  world.speedX.resize(size);
+  world.speedY.resize(size);
+  world.angle.resize(size);
+  world.axisX.resize(size);
+  world.axisY.resize(size);
+  world.halfWidth.resize(size);
+  world.halfHeight.resize(size);
+  world.owner.resize(size);
+  world.lifetime.resize(size);
+  world.id.resize(size);
+}
+
+int worldSpawn(const WorldSpawnData& record) {
+  int id;
+  if (!world.freeIds.empty()) {
+    id = world.freeIds.back();
+    world.freeIds.pop_back();
+  } else {
+    id = (int)world.slotOfId.size();
+    world.slotOfId.push_back(-1);
+  }
+
+  int slot = world.count++;
+  if ((int)world.x.size() < world.count) { resizeWorld(world.count); }
+
+  world.x[slot] = record.x;
+  world.y[slot] = record.y;
+  world.speedX[slot] = record.speedX;
+  world.speedY[slot] = record.speedY;
+  setWorldAngle(slot, record.angle);
+  world.halfWidth[slot] = record.halfWidth;
+  world.halfHeight[slot] = record.halfHeight;
+  world.owner[slot] = record.unitOwner;
+  world.lifetime[slot] = (record.lifetime > 0.0) ? record.lifetime : INFINITY;
+  world.id[slot] = id;
+  world.slotOfId[id] = slot;
+  return id;
+}
+
+void worldDespawnSlot(int slot) {
+  int last = --world.count;
+  world.slotOfId[world.id[slot]] = -1;
+  world.freeIds.push_back(world.id[slot]);
+  if (slot == last) { return; }
+
+  world.x[slot] = world.x[last];
+  world.y[slot] = world.y[last];
+  world.speedX[slot] = world.speedX[last];
+  world.speedY[slot] = world.speedY[last];
+  world.angle[slot] = world.angle[last];
+  world.axisX[slot] = world.axisX[last];
+  world.axisY[slot] = world.axisY[last];
+  world.halfWidth[slot] = world.halfWidth[last];
+  world.halfHeight[slot] = world.halfHeight[last];
+  world.owner[slot] = world.owner[last];
+  world.lifetime[slot] = world.lifetime[last];
+  world.id[slot] = world.id[last];
+  world.slotOfId[world.id[slot]] = slot;
+}
+
+int worldSlotOf(double id) {
+  if (!(id >= 0.0) || id >= (double)world.slotOfId.size()) { return -1; }
+  return world.slotOfId[(int)id];
+}
+
+// Moves every bullet by its speed and counts down its lifetime
+void integrateWorld(double timeScale) {
+  int n = world.count;
+  double* x = world.x.data();
+  double* y = world.y.data();
+  const double* speedX = world.speedX.data();
+  const double* speedY = world.speedY.data();
+  double* lifetime = world.lifetime.data();
+  for (int i = 0; i < n; ++i) {
+    x[i] += speedX[i] * timeScale;
+    y[i] += speedY[i] * timeScale;
+    lifetime[i] -= timeScale;
+  }
+}
+
+// Broadphase input and oriented rectangles for the world's bullets, with the id as bullet index
+// Expired bullets still waiting to be reported are inactive
+void unpackWorldBullets() {
+  int n = world.count;
+  unpackedBullets.resize(n);
+  orientedBoxes.centerX.assign(world.x.begin(), world.x.begin() + n);
+  orientedBoxes.centerY.assign(world.y.begin(), world.y.begin() + n);
+  orientedBoxes.axisX.assign(world.axisX.begin(), world.axisX.begin() + n);
+  orientedBoxes.axisY.assign(world.axisY.begin(), world.axisY.begin() + n);
+  orientedBoxes.halfWidth.assign(world.halfWidth.begin(), world.halfWidth.begin() + n);
+  orientedBoxes.halfHeight.assign(world.halfHeight.begin(), world.halfHeight.begin() + n);
+
+  for (int i = 0; i < n; ++i) {
+    double cosine = std::fabs(world.axisX[i]), sine = std::fabs(world.axisY[i]);
+    double extentX = cosine * world.halfWidth[i] + sine * world.halfHeight[i];
+    double extentY = sine * world.halfWidth[i] + cosine * world.halfHeight[i];
+    unpackedBullets[i] = BulletData{
+      world.x[i] - extentX, world.y[i] - extentY, world.x[i] + extentX, world.y[i] + extentY,
+      (world.lifetime[i] > 0.0) ? 1.0 : 0.0, world.owner[i], (double)world.id[i] };
+  }
+}
+
+// Flag of the world step header when events were dropped
+const double WORLD_EVENTS_OVERFLOW = 1.0;
+
+// Pair of bullet indices packed into one sortable key, lower index in the high half
+uint64_t contactKey(double indexA, double indexB) {
+  return ((uint64_t)(uint32_t)(int32_t)indexA << 32) | (uint32_t)(int32_t)indexB;
+}
+
+double contactIndexA(uint64_t key) { return (double)(int32_t)(uint32_t)(key >> 32); }
+double contactIndexB(uint64_t key) { return (double)(int32_t)(uint32_t)key; }
+
+// Sorted pair keys colliding as of the previous contacts call, and this call's
+// Both persist and swap roles every call
+std::vector<uint64_t> contactsPrevious;
+std::vector<uint64_t> contactsCurrent;
+ArenaVector<double> contactEnds = makeArenaVector<double>(frameArena);
+
+// Starts the frame arena over at the beginning of every call doing per-frame work
+// Every ArenaVector is recreated empty, since its old storage belongs to the previous call
+void beginCall() {
+  frameArena.reset();
+  bulletLayer = makeArenaVector<unsigned char>(frameArena);
+  grid.sizeScratch = makeArenaVector<double>(frameArena);
+  grid.bulletOrder = makeArenaVector<int>(frameArena);
+  collisionSlots = makeArenaVector<int>(frameArena);
+  bandFirstCell = makeArenaVector<int>(frameArena);
+  orientedBoxes = OrientedBoxes();
+  unpackedBullets = makeArenaVector<BulletData>(frameArena);
+  movingBullets = makeArenaVector<MovingBulletData>(frameArena);
+  contactEnds = makeArenaVector<double>(frameArena);
+}
+
+// Selects the broadphase: 0 = uniform grid, 1 = sweep and prune, 2 = dynamic AABB tree
+func double scr_entityGrid_set_broadphase(double mode) {
+  broadphaseMode = (int)mode;
+  return 0.0;
+}
+
+// Puts every bullet of the given owner on a collision layer (0 to 31)
+func double scr_entityGrid_set_owner_layer(double owner, double layer) {
+  int value = std::clamp((int)layer, 0, MAX_LAYERS - 1);
+  if (owner >= 0.0 && owner < MAX_TABLE_OWNER && owner == std::floor(owner)) {
+    if ((size_t)owner >= ownerLayerTable.size()) { ownerLayerTable.resize((size_t)owner + 1, 0); }
+    ownerLayerTable[(size_t)owner] = (unsigned char)value;
+  } else {
+    otherOwnerLayers[owner] = value;
+  }
+  numLayers = std::max(numLayers, value + 1);
+  return 0.0;
+}
+
+// Sets whether bullets on two layers can collide, including a layer with itself
+func double scr_entityGrid_set_layer_interaction(double layerA, double layerB, double collide) {
+  int a = std::clamp((int)layerA, 0, MAX_LAYERS - 1);
+  int b = std::clamp((int)layerB, 0, MAX_LAYERS - 1);
+  if (collide != 0.0) {
+    layerBlocked[a] &= ~(1u << b);
+    layerBlocked[b] &= ~(1u << a);
+  } else {
+    layerBlocked[a] |= 1u << b;
+    layerBlocked[b] |= 1u << a;
+  }
+  return 0.0;
+}
+
+// Removes all owner layers and lets every layer collide again
+func double scr_entityGrid_clear_layers() {
+  ownerLayerTable.clear();
+  otherOwnerLayers.clear();
+  numLayers = 1;
+  std::fill(std::begin(layerBlocked), std::end(layerBlocked), 0u);
+  return 0.0;
+}
+
+// Sets how many threads the narrow phase may use, 1 or less runs everything on the calling thread
+// Call with 1 before unloading the DLL to shut the workers down
+func double scr_entityGrid_set_threads(double threads) {
+  int count = std::max(1, (int)threads);
+  if (count != workerPool.size()) { workerPool.resize(count); }
+  return 0.0;
+}
+
+// Sets the grid cell size in pixels, or picks it automatically every call when size <= 0
+func double scr_entityGrid_set_cell_size(double size) {
+  cellSizeSetting = size;
+  return 0.0;
+}
+
+func double scr_entityGrid_bullets_collide(double* bulletBuffer, double* bulletCollisionsOut, double numBullets) {
+  beginCall();
+  BulletData* bulletArray = reinterpret_cast<BulletData*>(bulletBuffer);
+  int count = (int)numBullets;
+
+  findCollisions(bulletArray, count);
+
+  writeCollisions(bulletArray, bulletCollisionsOut);
+  return 0.0;
+}
+
+// Same as scr_entityGrid_bullets_collide, but only reports changes since the previous call
+// contactEventsOut receives [beginCount, endCount, begin pairs..., end pairs...], two indices per pair
+// Pairs stop colliding when they separate or when either bullet is gone from the buffer
+// Returns beginCount + endCount
+func double scr_entityGrid_bullets_contacts(double* bulletBuffer, double* contactEventsOut, double numBullets) {
+  beginCall();
+  BulletData* bulletArray = reinterpret_cast<BulletData*>(bulletBuffer);
+  int count = (int)numBullets;
+
+  findCollisions(bulletArray, count);
+
+  contactsCurrent.clear();
+  for (size_t i = 0; i < collisionSlots.size(); i += 2) {
+    double indexA = bulletArray[collisionSlots[i]].bulletIndex;
+    double indexB = bulletArray[collisionSlots[i + 1]].bulletIndex;
+    contactsCurrent.push_back(contactKey(std::min(indexA, indexB), std::max(indexA, indexB)));
+  }
+  std::sort(contactsCurrent.begin(), contactsCurrent.end());
+  contactsCurrent.erase(std::unique(contactsCurrent.begin(), contactsCurrent.end()), contactsCurrent.end());
+
+  // Merge walk over both sorted sets; begins are written first, ends collected in contactEnds
+  double* beginOut = contactEventsOut + 2;
+  int beginCount = 0;
+  contactEnds.reserve(contactsPrevious.size() * 2);
+
+  size_t previous = 0, current = 0;
+  while (previous < contactsPrevious.size() || current < contactsCurrent.size()) {
+    if (current == contactsCurrent.size() ||
+      (previous < contactsPrevious.size() && contactsPrevious[previous] < contactsCurrent[current])) {
+      contactEnds.push_back(contactIndexA(contactsPrevious[previous]));
+      contactEnds.push_back(contactIndexB(contactsPrevious[previous]));
+      previous++;
+    } else if (previous == contactsPrevious.size() || contactsCurrent[current] < contactsPrevious[previous]) {
+      *beginOut++ = contactIndexA(contactsCurrent[current]);
+      *beginOut++ = contactIndexB(contactsCurrent[current]);
+      beginCount++;
+      current++;
+    } else {
+      // Still colliding
+      previous++;
+      current++;
+    }
+  }
+
+  int endCount = (int)contactEnds.size() / 2;
+  std::copy(contactEnds.begin(), contactEnds.end(), beginOut);
+  contactEventsOut[0] = beginCount;
+  contactEventsOut[1] = endCount;
+
+  std::swap(contactsPrevious, contactsCurrent);
+  return beginCount + endCount;
+}
+
+// Forgets every cached contact, e.g. on room change; the next contacts call reports all pairs as begins
+func double scr_entityGrid_contacts_reset() {
+  contactsPrevious.clear();
   return 0.0;
 }
+
+// Same as scr_entityGrid_bullets_collide, for RotatedBulletData records
+// Pairs passing the AABB test are kept only if their rotated rectangles overlap as well
+func double scr_entityGrid_bullets_collide_rotated(double* bulletBuffer, double* bulletCollisionsOut, double numBullets) {
+  beginCall();
+  RotatedBulletData* records = reinterpret_cast<RotatedBulletData*>(bulletBuffer);
+  int count = (int)numBullets;
+
+  unpackRotatedBullets(records, count);
+  findCollisions(unpackedBullets.data(), count);
+
+  StatsClock::time_point filterStart;
+  if (statsEnabled) { filterStart = StatsClock::now(); }
+  int kept = filterOrientedPairs(collisionSlots.data(), (int)collisionSlots.size() / 2);
+  collisionSlots.resize(kept * 2);
+  recordPairFilter(filterStart, kept);
+
+  writeCollisions(unpackedBullets.data(), bulletCollisionsOut);
+  return 0.0;
+}
+
+// Same as scr_entityGrid_bullets_collide, for MovingBulletData records
+// Pairs whose paths overlap somewhere in the step are written as triples [lower index, higher index, time],
+// where time in [0, 1] is the fraction of the step at which they first touch
+// Returns the number of pairs written
+func double scr_entityGrid_bullets_collide_swept(double* bulletBuffer, double* bulletCollisionsOut, double numBullets) {
+  beginCall();
+  MovingBulletData* records = reinterpret_cast<MovingBulletData*>(bulletBuffer);
+  int count = (int)numBullets;
+
+  unpackMovingBullets(records, count);
+  findCollisions(unpackedBullets.data(), count);
+
+  StatsClock::time_point filterStart;
+  if (statsEnabled) { filterStart = StatsClock::now(); }
+  int numPairs = 0;
+  for (size_t i = 0; i < collisionSlots.size(); i += 2) {
+    MovingBulletData& a = movingBullets[collisionSlots[i]];
+    MovingBulletData& b = movingBullets[collisionSlots[i + 1]];
+    double time = timeOfImpact(a, b);
+    if (time < 0.0) { continue; }
+
+    *bulletCollisionsOut++ = std::min(a.bulletIndex, b.bulletIndex);
+    *bulletCollisionsOut++ = std::max(a.bulletIndex, b.bulletIndex);
+    *bulletCollisionsOut++ = time;
+    numPairs++;
+  }
+  recordPairFilter(filterStart, numPairs);
+  return numPairs;
+}
+
+// Enables the profiling counters read by scr_entityGrid_read_stats; while off they cost nothing
+func double scr_entityGrid_set_stats(double enable) {
+  statsEnabled = (enable != 0.0);
+  collisionStats = {};
+  return 0.0;
+}
+
+// Writes the counters of the last collision call to statsOut, in CollisionStats order:
+// [buildMs, queryMs, totalCells, occupiedCells, maxCellLoad, candidates, ownerRejects, emitted, occupancy bins...]
+// Returns the number of values written
+func double scr_entityGrid_read_stats(double* statsOut) {
+  const double* values = reinterpret_cast<const double*>(&collisionStats);
+  int count = (int)(sizeof(CollisionStats) / sizeof(double));
+  std::copy(values, values + count, statsOut);
+  return count;
+}
+
+// Number of heap allocations the DLL has made so far; it stops rising once frames reach a steady state
+// Counts only the arenas' own blocks unless built with GMS2_COUNT_ALLOCATIONS
+func double scr_entityGrid_allocation_count() {
+  return (double)heapAllocationCount.load();
+}
+
+func double scr_entityGrid_abi_version() {
+  return COLLIDE_ABI_VERSION;
+}
+
+// Same as scr_entityGrid_bullets_collide, for CompactBulletData records
+// collisionsOut receives a CompactCollisionHeader followed by up to outCapacity pairs of int32 indices,
+// lower index first; pairs past the capacity are dropped and flagged with COMPACT_OVERFLOW
+// Returns the number of pairs written
+func double scr_entityGrid_bullets_collide_v2(void* bulletBuffer, void* collisionsOut, double numBullets, double outCapacity) {
+  beginCall();
+  CompactBulletData* records = reinterpret_cast<CompactBulletData*>(bulletBuffer);
+  CompactCollisionHeader* header = reinterpret_cast<CompactCollisionHeader*>(collisionsOut);
+  int32_t* pairsOut = reinterpret_cast<int32_t*>(header + 1);
+  int count = (int)numBullets;
+  int capacity = std::max(0, (int)outCapacity);
+
+  unpackCompactBullets(records, count);
+  findCollisions(unpackedBullets.data(), count);
+
+  int pairsFound = (int)collisionSlots.size() / 2;
+  int pairsWritten = std::min(pairsFound, capacity);
+  for (int p = 0; p < pairsWritten; ++p) {
+    int32_t indexA = records[collisionSlots[2 * p]].bulletIndex;
+    int32_t indexB = records[collisionSlots[2 * p + 1]].bulletIndex;
+    pairsOut[2 * p] = std::min(indexA, indexB);
+    pairsOut[2 * p + 1] = std::max(indexA, indexB);
+  }
+
+  header->pairsFound = pairsFound;
+  header->flags = (pairsFound > capacity) ? COMPACT_OVERFLOW : 0;
+  return pairsWritten;
+}
+
+// Adds a bullet to the native world and returns its id
+// lifetime is in steps, 0 or less keeps the bullet until it is despawned
+func double scr_entityGrid_world_spawn(double x, double y, double speedX, double speedY, double angle,
+  double halfWidth, double halfHeight, double unitOwner, double lifetime) {
+  return worldSpawn(WorldSpawnData{ x, y, speedX, speedY, angle, halfWidth, halfHeight, unitOwner, lifetime });
+}
+
+// Adds numRecords WorldSpawnData records at once, writing the id of each to idsOut
+// Returns the number of bullets spawned
+func double scr_entityGrid_world_spawn_buffer(double* spawnBuffer, double* idsOut, double numRecords) {
+  WorldSpawnData* records = reinterpret_cast<WorldSpawnData*>(spawnBuffer);
+  int count = (int)numRecords;
+  for (int i = 0; i < count; ++i) {
+    idsOut[i] = worldSpawn(records[i]);
+  }
+  return count;
+}
+
+// Removes a bullet from the world; returns 1 if it existed
+func double scr_entityGrid_world_despawn(double id) {
+  int slot = worldSlotOf(id);
+  if (slot < 0) { return 0.0; }
+  worldDespawnSlot(slot);
+  return 1.0;
+}
+
+// Overwrites position, speed and angle of the bullets in numRecords WorldUpdateData records
+// Returns the number of records whose bullet still existed
+func double scr_entityGrid_world_update(double* updateBuffer, double numRecords) {
+  WorldUpdateData* records = reinterpret_cast<WorldUpdateData*>(updateBuffer);
+  int count = (int)numRecords;
+  int updated = 0;
+  for (int i = 0; i < count; ++i) {
+    int slot = worldSlotOf(records[i].id);
+    if (slot < 0) { continue; }
+    world.x[slot] = records[i].x;
+    world.y[slot] = records[i].y;
+    world.speedX[slot] = records[i].speedX;
+    world.speedY[slot] = records[i].speedY;
+    if (records[i].angle != world.angle[slot]) { setWorldAngle(slot, records[i].angle); }
+    updated++;
+  }
+  return updated;
+}
+
+// Advances the world by timeScale steps (1 for a normal step): moves every bullet, removes the ones
+// whose lifetime ran out and collides the rest as rotated rectangles with the selected broadphase
+// eventsOut receives [expiredCount, hitCount, flags, expired ids..., hit pairs...], lower id first in each pair,
+// and holds eventCapacity values in total; events past it are flagged with WORLD_EVENTS_OVERFLOW
+// Hits past the capacity are dropped, while expired bullets that don't fit stay in the world, out of the
+// collisions, and are reported and removed by the next step with room for them
+// Returns expiredCount + hitCount
+func double scr_entityGrid_world_step(double timeScale, double* eventsOut, double eventCapacity) {
+  beginCall();
+  int capacity = std::max(0, (int)eventCapacity - 3);
+  double* out = eventsOut + 3;
+  int written = 0;
+  bool overflow = false;
+
+  integrateWorld(timeScale);
+
+  // Backwards, so the bullet moved into a freed slot has already been checked
+  int expiredCount = 0;
+  for (int slot = world.count - 1; slot >= 0; --slot) {
+    if (world.lifetime[slot] > 0.0) { continue; }
+    if (written == capacity) {
+      overflow = true;
+      continue;
+    }
+    out[written++] = world.id[slot];
+    expiredCount++;
+    worldDespawnSlot(slot);
+  }
+
+  unpackWorldBullets();
+  findCollisions(unpackedBullets.data(), world.count);
+  StatsClock::time_point filterStart;
+  if (statsEnabled) { filterStart = StatsClock::now(); }
+  int kept = filterOrientedPairs(collisionSlots.data(), (int)collisionSlots.size() / 2);
+  recordPairFilter(filterStart, kept);
+
+  int hitCount = 0;
+  for (int p = 0; p < kept; ++p) {
+    if (written + 2 > capacity) {
+      overflow = true;
+      break;
+    }
+    int idA = world.id[collisionSlots[2 * p]];
+    int idB = world.id[collisionSlots[2 * p + 1]];
+    out[written++] = std::min(idA, idB);
+    out[written++] = std::max(idA, idB);
+    hitCount++;
+  }
+
+  if (eventCapacity >= 3) {
+    eventsOut[0] = expiredCount;
+    eventsOut[1] = hitCount;
+    eventsOut[2] = overflow ? WORLD_EVENTS_OVERFLOW : 0.0;
+  }
+  return expiredCount + hitCount;
+}
+
+// Writes [id, x, y, angle] of every bullet in the world to transformsOut, for drawing
+// Returns the number of bullets written
+func double scr_entityGrid_world_transforms(double* transformsOut) {
+  for (int i = 0; i < world.count; ++i) {
+    *transformsOut++ = world.id[i];
+    *transformsOut++ = world.x[i];
+    *transformsOut++ = world.y[i];
+    *transformsOut++ = world.angle[i];
+  }
+  return world.count;
+}
+
+func double scr_entityGrid_world_count() {
+  return world.count;
+}
+
+// Removes every bullet from the world, e.g. on room change
+func double scr_entityGrid_world_clear() {
+  world.count = 0;
+  world.slotOfId.clear();
+  world.freeIds.clear();
+  return 0.0;
+}
+
+// Query calls below reuse the grid of the last collision call (bullets_collide, its variants or world_step),
+// so bullets are where they were at that call; the grid is built on first use when another broadphase is selected
+// Overlap queries test AABBs and ignore layers
+
+// Finds the bullets overlapping each of numQueries CircleQueryData circles
+// resultsOut receives the CompactQueryHeader layout with at most resultCapacity indices
+// Returns the number of indices written
+func double scr_entityGrid_query_circles(double* queryBuffer, void* resultsOut, double numQueries, double resultCapacity) {
+  beginCall();
+  return runOverlapQueries(reinterpret_cast<CircleQueryData*>(queryBuffer), (int)numQueries, resultsOut, std::max(0, (int)resultCapacity));
+}
+
+// Same as scr_entityGrid_query_circles, for RectQueryData rectangles
+func double scr_entityGrid_query_rects(double* queryBuffer, void* resultsOut, double numQueries, double resultCapacity) {
+  beginCall();
+  return runOverlapQueries(reinterpret_cast<RectQueryData*>(queryBuffer), (int)numQueries, resultsOut, std::max(0, (int)resultCapacity));
+}
+
+// Finds the first bullet along each of numQueries RayQueryData segments
+// hitsOut receives one CompactRayHit per query; returns the number of segments that hit something
+func double scr_entityGrid_query_rays(double* queryBuffer, void* hitsOut, double numQueries) {
+  beginCall();
+  RayQueryData* queries = reinterpret_cast<RayQueryData*>(queryBuffer);
+  CompactRayHit* hits = reinterpret_cast<CompactRayHit*>(hitsOut);
+  int count = (int)numQueries;
+  ensureQueryGrid();
+
+  int numHits = 0;
+  for (int q = 0; q < count; ++q) {
+    hits[q] = raycastGrid(queries[q]);
+    if (hits[q].bulletIndex >= 0) { numHits++; }
+  }
+  return numHits;
+}
@@ -0,0 +1,132 @@
+/*
+- Per-call scratch memory shared by the external functions for GameMaker
+- A bump allocator that each exported call resets on entry, so temporary containers cost no malloc calls
+- Blocks are only ever merged into bigger ones, so once the largest frame has been seen later frames reuse its memory
+- Define GMS2_COUNT_ALLOCATIONS to count every operator new in the DLL as well, to check steady-state frames make none
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Heap allocations made by the arenas, and by operator new with GMS2_COUNT_ALLOCATIONS
+inline std::atomic<unsigned long long> heapAllocationCount{ 0 };
+
+class FrameArena {
+public:
+  static const size_t INITIAL_BLOCK_SIZE = 64 * 1024;
+
+  FrameArena() = default;
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+  ~FrameArena() { releaseBlocks(); }
+
+  void* allocate(size_t bytes, size_t alignment) {
+    size_t offset = alignedOffset(alignment);
+    if (current == nullptr || offset + bytes > current->size) {
+      addBlock(std::max(bytes + alignment, current ? current->size * 2 : INITIAL_BLOCK_SIZE));
+      offset = alignedOffset(alignment);
+    }
+    used = offset + bytes;
+    return current->data() + offset;
+  }
+
+  // Frees everything allocated since the last reset
+  // A frame that needed several blocks gets them merged into one that fits it whole
+  void reset() {
+    if (current != nullptr && current->previous != nullptr) {
+      size_t total = 0;
+      for (Block* block = current; block != nullptr; block = block->previous) { total += block->size; }
+      releaseBlocks();
+      addBlock(total);
+    }
+    used = 0;
+  }
+
+private:
+  struct Block {
+    Block* previous;
+    size_t size;
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+  };
+
+  Block* current = nullptr;
+  size_t used = 0;
+
+  size_t alignedOffset(size_t alignment) const {
+    if (current == nullptr) { return 0; }
+    uintptr_t base = reinterpret_cast<uintptr_t>(current->data());
+    uintptr_t next = (base + used + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    return next - base;
+  }
+
+  void addBlock(size_t size) {
+    Block* block = static_cast<Block*>(std::malloc(sizeof(Block) + size));
+    if (block == nullptr) { throw std::bad_alloc(); }
+    heapAllocationCount++;
+    block->previous = current;
+    block->size = size;
+    current = block;
+    used = 0;
+  }
+
+  void releaseBlocks() {
+    while (current != nullptr) {
+      Block* previous = current->previous;
+      std::free(current);
+      current = previous;
+    }
+    used = 0;
+  }
+};
+
+// Standard allocator drawing from a FrameArena; freeing is a no-op, the arena reset takes care of it
+template <typename T>
+struct ArenaAllocator {
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+
+  FrameArena* arena;
+
+  explicit ArenaAllocator(FrameArena& frameArena) : arena(&frameArena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+  T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+  void deallocate(T*, size_t) {}
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+// Vector whose storage lives in a FrameArena; it must be recreated after the arena is reset
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+template <typename T>
+ArenaVector<T> makeArenaVector(FrameArena& arena, size_t capacity = 0) {
+  ArenaVector<T> vector{ ArenaAllocator<T>(arena) };
+  vector.reserve(capacity);
+  return vector;
+}
+
+#ifdef GMS2_COUNT_ALLOCATIONS
+// Each DLL is a single translation unit, so replacing these here replaces them for the whole DLL
+void* operator new(size_t size) {
+  heapAllocationCount++;
+  if (void* memory = std::malloc(size ? size : 1)) { return memory; }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+#endif